@@ -6,6 +6,7 @@
 #include "tracker.h"
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
 #include <stdio.h>
 
@@ -0,0 +1,72 @@
+// mtrack: bench.c: Compares the t-prefix variants to the standard library.
+// Copyright (C) 2021 Ethan Uppal. All rights reserved.
+
+#define MTRACK_ENABLE
+#include "tracker.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+// The most a tmalloc/tfree pair may cost over a malloc/free pair, in ns.
+#ifndef BENCH_MAX_OVERHEAD
+#define BENCH_MAX_OVERHEAD 5
+#endif
+
+#define BENCH_ITERATIONS 2000000
+#define BENCH_ROUNDS 15
+#define BENCH_SIZE 32
+
+// Called through volatile pointers so that the compiler cannot pair up and
+// remove the malloc and free.
+static void* (*volatile raw_malloc)(size_t) = malloc;
+static void (*volatile raw_free)(void*) = free;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static double bench_raw(void) {
+    const double start = now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        raw_free(raw_malloc(BENCH_SIZE));
+    }
+    return (now() - start) / BENCH_ITERATIONS;
+}
+
+static double bench_tracked(void) {
+    const double start = now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        void* block = tmalloc(BENCH_SIZE);
+        tfree(block);
+    }
+    return (now() - start) / BENCH_ITERATIONS;
+}
+
+int main(void) {
+    tinit();
+
+    // Take the fastest round of each to discount noise from the machine
+    double raw = 0, tracked = 0;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        const double r = bench_raw();
+        const double t = bench_tracked();
+        if (round == 0 || r < raw) {
+            raw = r;
+        }
+        if (round == 0 || t < tracked) {
+            tracked = t;
+        }
+    }
+    const double overhead = tracked - raw;
+    printf("malloc/free: %.2fns, tmalloc/tfree: %.2fns, overhead: %.2fns\n",
+           raw, tracked, overhead);
+
+    tdestroy();
+    if (overhead > BENCH_MAX_OVERHEAD) {
+        printf("Overhead exceeds %dns\n", BENCH_MAX_OVERHEAD);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
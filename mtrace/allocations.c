@@ -20,21 +20,85 @@ void mtrack_allocations_init(mtrack_allocations_t* allocations) {
     if (allocations->array == NULL) {
         trace_abort("Unable to setup tracing because virtual memory is exhausted\n");
     }
+    allocations->operations = 0;
+    allocations->live_bytes = 0;
+    allocations->peak_bytes = 0;
+    allocations->track_peak = false;
+    allocations->peak_pending = false;
+    mtrack_snapshot_init(&allocations->peak);
 }
 
 void mtrack_allocations_destroy(mtrack_allocations_t* allocations) {
     free(allocations->array);
+    mtrack_snapshot_destroy(&allocations->peak);
 }
 
-mtrack_instance_t* mtrack_allocations_get(mtrack_allocations_t* allocations,
-                                          void* pointer) {
-    // First try to find it
+// Forgets everything parsed so far, but not whether the peak is tracked.
+void mtrack_allocations_reset(mtrack_allocations_t* allocations) {
+    allocations->length = 0;
+    allocations->operations = 0;
+    allocations->live_bytes = 0;
+    allocations->peak_bytes = 0;
+    allocations->peak_pending = false;
+    allocations->peak.length = 0;
+    allocations->peak.operations = 0;
+}
+
+// Returns the live blocks at the point the most bytes were live.
+const mtrack_snapshot_t* mtrack_allocations_peak(mtrack_allocations_t* allocations) {
+    if (allocations->peak_pending) {
+        mtrack_snapshot_take(&allocations->peak, allocations);
+        allocations->peak_pending = false;
+    }
+    return &allocations->peak;
+}
+
+void mtrack_snapshot_init(mtrack_snapshot_t* snapshot) {
+    snapshot->length = 0;
+    snapshot->capacity = 4;
+    snapshot->array = (mtrack_block_t*)malloc(sizeof(mtrack_block_t)
+                                              * snapshot->capacity);
+    if (snapshot->array == NULL) {
+        trace_abort("Unable to setup tracing because virtual memory is exhausted\n");
+    }
+    snapshot->operations = 0;
+}
+
+void mtrack_snapshot_destroy(mtrack_snapshot_t* snapshot) {
+    free(snapshot->array);
+}
+
+void mtrack_snapshot_push(mtrack_snapshot_t* snapshot, mtrack_block_t block) {
+    if (snapshot->length + 1 > snapshot->capacity) {
+        snapshot->capacity *= 2;
+        snapshot->array = realloc(snapshot->array,
+                                  sizeof(mtrack_block_t)
+                                  * snapshot->capacity);
+    }
+    snapshot->array[snapshot->length++] = block;
+}
+
+void mtrack_snapshot_take(mtrack_snapshot_t* snapshot,
+                          const mtrack_allocations_t* allocations) {
+    snapshot->length = 0;
+    snapshot->operations = allocations->operations;
     for (size_t i = 0; i < allocations->length; i++) {
-        if (allocations->array[i].pointer == pointer) {
-            return &allocations->array[i];
+        const mtrack_instance_t* instance = &allocations->array[i];
+        if (!instance->freed) {
+            mtrack_block_t block = {
+                .pointer = instance->pointer,
+                .bytes = instance->bytes,
+                .line = instance->start_line,
+                .file = instance->start_file,
+                .serial = instance->serial
+            };
+            mtrack_snapshot_push(snapshot, block);
         }
     }
-    // If not make new one
+}
+
+mtrack_instance_t* mtrack_allocations_push(mtrack_allocations_t* allocations,
+                                           void* pointer) {
     if (allocations->length + 1 > allocations->capacity) {
         allocations->capacity *= 2;
         allocations->array = realloc(allocations->array,
@@ -50,9 +114,22 @@ mtrack_instance_t* mtrack_allocations_get(mtrack_allocations_t* allocations,
     instance->end_line = 0;
     instance->end_file = NULL;
     instance->freed = true;
+    instance->serial = 0;
     return instance;
 }
 
+mtrack_instance_t* mtrack_allocations_get(mtrack_allocations_t* allocations,
+                                          void* pointer) {
+    // First try to find it
+    for (size_t i = 0; i < allocations->length; i++) {
+        if (allocations->array[i].pointer == pointer) {
+            return &allocations->array[i];
+        }
+    }
+    // If not make new one
+    return mtrack_allocations_push(allocations, pointer);
+}
+
 int mtrack_allocations_alloc(mtrack_allocations_t* allocations, void* pointer,
                              size_t bytes, size_t line, const char* file,
                              FILE* ostream) {
@@ -65,6 +142,13 @@ int mtrack_allocations_alloc(mtrack_allocations_t* allocations, void* pointer,
     instance->start_line = line;
     instance->start_file = file;
     instance->freed = false;
+    instance->serial = allocations->operations++;
+    allocations->live_bytes += bytes;
+    if (allocations->track_peak
+        && allocations->live_bytes > allocations->peak_bytes) {
+        allocations->peak_bytes = allocations->live_bytes;
+        allocations->peak_pending = true;
+    }
     return 0;
 }
 
@@ -79,9 +163,15 @@ int mtrack_allocations_free(mtrack_allocations_t* allocations, void* pointer,
         }
         return MTRACK_ISSUE_DETECTED;
     }
+    // Capture the peak before the first free that ends it
+    if (allocations->track_peak) {
+        mtrack_allocations_peak(allocations);
+    }
     instance->end_line = line;
     instance->end_file = file;
     instance->freed = true;
+    allocations->operations++;
+    allocations->live_bytes -= instance->bytes;
     return 0;
 }
 
@@ -17,16 +17,49 @@ typedef struct {
     size_t end_line;
     const char* end_file;
     bool freed;
+    size_t serial; // Operations parsed before this was allocated
 } mtrack_instance_t;
 
+// A live block as it was when a snapshot was taken.
+typedef struct {
+    void* pointer;
+    size_t bytes;
+    size_t line;
+    const char* file;
+    size_t serial;
+} mtrack_block_t;
+
+typedef struct {
+    size_t length;
+    size_t capacity;
+    mtrack_block_t* array;
+    size_t operations; // Operations parsed when the snapshot was taken
+} mtrack_snapshot_t;
+
 typedef struct {
     size_t length;
     size_t capacity;
     mtrack_instance_t* array;
+    size_t operations;
+    size_t live_bytes;
+    size_t peak_bytes;
+    bool track_peak;   // Whether peak is kept up to date, for --layout
+    bool peak_pending; // The peak is the current state and not yet in peak
+    mtrack_snapshot_t peak;
 } mtrack_allocations_t;
 
 void mtrack_allocations_init(mtrack_allocations_t* allocations);
 void mtrack_allocations_destroy(mtrack_allocations_t* allocations);
+mtrack_instance_t* mtrack_allocations_push(mtrack_allocations_t* allocations,
+                                           void* pointer);
+void mtrack_allocations_reset(mtrack_allocations_t* allocations);
+const mtrack_snapshot_t* mtrack_allocations_peak(mtrack_allocations_t* allocations);
+
+void mtrack_snapshot_init(mtrack_snapshot_t* snapshot);
+void mtrack_snapshot_destroy(mtrack_snapshot_t* snapshot);
+void mtrack_snapshot_push(mtrack_snapshot_t* snapshot, mtrack_block_t block);
+void mtrack_snapshot_take(mtrack_snapshot_t* snapshot,
+                          const mtrack_allocations_t* allocations);
 
 int mtrack_parse(mtrack_allocations_t* allocations, char* line,
                  size_t length, FILE* ostream);
@@ -0,0 +1,242 @@
+// mtrace: checkpoint.c
+// Copyright (C) 2023 Ethan Uppal. All rights reserved.
+
+#include "checkpoint.h"
+#include <stdlib.h> // malloc, free
+#include <string.h> // strlen
+#include <inttypes.h> // PRIu64, SCNu64
+#include <stdint.h> // uintptr_t
+
+#define CHECKPOINT_MAGIC "mtrace-checkpoint 5"
+
+void mtrack_checkpoint_init(mtrack_checkpoint_t* checkpoint) {
+    checkpoint->offset = 0;
+    checkpoint->issue_count = 0;
+    checkpoint->analysis_length = 0;
+    checkpoint->fingerprint = 0;
+    checkpoint->line_offset = 0;
+    checkpoint->line_fingerprint = MTRACK_HASH_SEED;
+    checkpoint->analysis_fingerprint = MTRACK_HASH_SEED;
+}
+
+static inline uint64_t hash_byte(uint64_t hash, int c) {
+    return (hash ^ (unsigned char)c) * 1099511628211ULL;
+}
+
+// Continues an FNV-1a hash over bytes [start, end) of the stream. Bytes
+// missing from the stream are hashed as EOF, so a short stream will not match.
+uint64_t mtrack_hash(FILE* stream, long start, long end, uint64_t hash) {
+    fseek(stream, start, SEEK_SET);
+    for (long i = start; i < end; i++) {
+        hash = hash_byte(hash, getc(stream));
+    }
+    clearerr(stream);
+    return hash;
+}
+
+// FNV-1a over the first line of the log. Every run of a tracked program
+// truncates the log, so this tells a grown log apart from a new one.
+uint64_t mtrack_checkpoint_fingerprint(FILE* istream) {
+    uint64_t hash = MTRACK_HASH_SEED;
+    rewind(istream);
+    int c;
+    while ((c = getc(istream)) != EOF) {
+        hash = hash_byte(hash, c);
+        if (c == '\n') {
+            break;
+        }
+    }
+    clearerr(istream);
+    return hash;
+}
+
+// A log is still the one the checkpoint was taken from if it has not shrunk
+// and both its first line and the last line parsed are unchanged. The first
+// line alone repeats whenever allocation addresses are deterministic.
+bool mtrack_checkpoint_valid(const mtrack_checkpoint_t* checkpoint,
+                             FILE* istream) {
+    if (fseek(istream, 0, SEEK_END) != 0
+        || ftell(istream) < checkpoint->offset
+        || mtrack_checkpoint_fingerprint(istream) != checkpoint->fingerprint) {
+        return false;
+    }
+    if (checkpoint->offset == 0) {
+        return true;
+    }
+    // The offset must still fall just after a line
+    fseek(istream, checkpoint->offset - 1, SEEK_SET);
+    const int c = getc(istream);
+    clearerr(istream);
+    return c == '\n'
+           && mtrack_hash(istream, checkpoint->line_offset, checkpoint->offset,
+                          MTRACK_HASH_SEED)
+              == checkpoint->line_fingerprint;
+}
+
+// Whether the issues at the start of the analysis are the ones the checkpoint
+// was written alongside, rather than another file at the same path.
+bool mtrack_checkpoint_owns(const mtrack_checkpoint_t* checkpoint,
+                            FILE* ostream) {
+    if (fseek(ostream, 0, SEEK_END) != 0
+        || ftell(ostream) < checkpoint->analysis_length) {
+        return false;
+    }
+    return mtrack_hash(ostream, 0, checkpoint->analysis_length,
+                       MTRACK_HASH_SEED)
+           == checkpoint->analysis_fingerprint;
+}
+
+static void write_file(const char* file, FILE* stream) {
+    if (file) {
+        fputs(file, stream);
+    }
+}
+
+static bool read_file(const char** file, size_t length, FILE* stream) {
+    if (length == 0) {
+        *file = NULL;
+        return true;
+    }
+    char* buffer = malloc(length + 1);
+    if (buffer == NULL || fread(buffer, 1, length, stream) != length) {
+        free(buffer);
+        return false;
+    }
+    buffer[length] = '\0';
+    *file = buffer;
+    return true;
+}
+
+bool mtrack_checkpoint_load(mtrack_checkpoint_t* checkpoint,
+                            mtrack_allocations_t* allocations,
+                            const char* path) {
+    FILE* stream = fopen(path, "r");
+    if (stream == NULL) {
+        return false;
+    }
+    char magic[sizeof(CHECKPOINT_MAGIC) + 1] = {0};
+    size_t count;
+    int track_peak, peak_pending;
+    if (fgets(magic, sizeof(magic), stream) == NULL
+        || strcmp(magic, CHECKPOINT_MAGIC "\n") != 0
+        || fscanf(stream, "%ld %zu %ld %" SCNu64 " %ld %" SCNu64 " %" SCNu64
+                  " %zu %zu %zu %d %d %zu",
+                  &checkpoint->offset, &checkpoint->issue_count,
+                  &checkpoint->analysis_length, &checkpoint->fingerprint,
+                  &checkpoint->line_offset, &checkpoint->line_fingerprint,
+                  &checkpoint->analysis_fingerprint,
+                  &allocations->operations, &allocations->live_bytes,
+                  &allocations->peak_bytes, &track_peak, &peak_pending,
+                  &count) != 13) {
+        goto corrupt;
+    }
+    allocations->track_peak = track_peak;
+    allocations->peak_pending = peak_pending;
+    for (size_t i = 0; i < count; i++) {
+        uintptr_t pointer_int;
+        size_t bytes, serial, start_line, end_line, start_length, end_length;
+        int freed;
+        if (fscanf(stream, "%zu %zu %d %zu %zu %zu %zu %zu", &pointer_int,
+                   &bytes, &freed, &serial, &start_line, &end_line,
+                   &start_length, &end_length) != 8
+            || getc(stream) != ' ') {
+            goto corrupt;
+        }
+        mtrack_instance_t* instance =
+            mtrack_allocations_push(allocations, (void*)pointer_int);
+        instance->bytes = bytes;
+        instance->freed = freed;
+        instance->serial = serial;
+        instance->start_line = start_line;
+        instance->end_line = end_line;
+        if (!read_file(&instance->start_file, start_length, stream)
+            || !read_file(&instance->end_file, end_length, stream)) {
+            goto corrupt;
+        }
+    }
+    mtrack_snapshot_t* peak = &allocations->peak;
+    if (fscanf(stream, "%zu %zu", &peak->operations, &count) != 2) {
+        goto corrupt;
+    }
+    for (size_t i = 0; i < count; i++) {
+        uintptr_t pointer_int;
+        size_t file_length;
+        mtrack_block_t block;
+        if (fscanf(stream, "%zu %zu %zu %zu %zu", &pointer_int, &block.bytes,
+                   &block.serial, &block.line, &file_length) != 5
+            || getc(stream) != ' '
+            || !read_file(&block.file, file_length, stream)) {
+            goto corrupt;
+        }
+        block.pointer = (void*)pointer_int;
+        mtrack_snapshot_push(peak, block);
+    }
+    fclose(stream);
+    return true;
+
+corrupt:
+    mtrack_allocations_reset(allocations);
+    mtrack_checkpoint_init(checkpoint);
+    fclose(stream);
+    return false;
+}
+
+bool mtrack_checkpoint_save(const mtrack_checkpoint_t* checkpoint,
+                            const mtrack_allocations_t* allocations,
+                            const char* path) {
+    // Write beside the checkpoint and rename over it so that a crash midway
+    // never leaves behind a truncated checkpoint.
+    char* temporary = malloc(strlen(path) + sizeof(".tmp"));
+    if (temporary == NULL) {
+        return false;
+    }
+    strcpy(temporary, path);
+    strcat(temporary, ".tmp");
+    FILE* stream = fopen(temporary, "w");
+    if (stream == NULL) {
+        free(temporary);
+        return false;
+    }
+    fprintf(stream, CHECKPOINT_MAGIC "\n%ld %zu %ld %" PRIu64 " %ld %" PRIu64
+            " %" PRIu64 "\n%zu %zu %zu %d %d\n%zu\n",
+            checkpoint->offset, checkpoint->issue_count,
+            checkpoint->analysis_length, checkpoint->fingerprint,
+            checkpoint->line_offset, checkpoint->line_fingerprint,
+            checkpoint->analysis_fingerprint,
+            allocations->operations, allocations->live_bytes,
+            allocations->peak_bytes, allocations->track_peak,
+            allocations->peak_pending,
+            allocations->length);
+    for (size_t i = 0; i < allocations->length; i++) {
+        const mtrack_instance_t* instance = &allocations->array[i];
+        fprintf(stream, "%zu %zu %d %zu %zu %zu %zu %zu ",
+                (uintptr_t)instance->pointer, instance->bytes,
+                instance->freed, instance->serial, instance->start_line,
+                instance->end_line,
+                instance->start_file ? strlen(instance->start_file) : 0,
+                instance->end_file ? strlen(instance->end_file) : 0);
+        write_file(instance->start_file, stream);
+        write_file(instance->end_file, stream);
+        putc('\n', stream);
+    }
+    // The peak is only worth keeping while it is tracked
+    const mtrack_snapshot_t* peak = &allocations->peak;
+    const size_t peak_length = allocations->track_peak ? peak->length : 0;
+    fprintf(stream, "%zu %zu\n", peak->operations, peak_length);
+    for (size_t i = 0; i < peak_length; i++) {
+        const mtrack_block_t* block = &peak->array[i];
+        fprintf(stream, "%zu %zu %zu %zu %zu ", (uintptr_t)block->pointer,
+                block->bytes, block->serial, block->line,
+                block->file ? strlen(block->file) : 0);
+        write_file(block->file, stream);
+        putc('\n', stream);
+    }
+    bool ok = !ferror(stream);
+    ok = fclose(stream) == 0 && ok;
+    ok = ok && rename(temporary, path) == 0;
+    if (!ok) {
+        remove(temporary);
+    }
+    free(temporary);
+    return ok;
+}
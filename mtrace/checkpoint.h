@@ -0,0 +1,40 @@
+// mtrace: checkpoint.h
+// Copyright (C) 2023 Ethan Uppal. All rights reserved.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "allocations.h"
+
+// The progress of an analysis through a log, so that a later run can resume
+// from where this one stopped instead of reparsing the whole log.
+typedef struct {
+    long offset;               // Bytes of the log reflected in the allocations
+    size_t issue_count;        // Issues reported while parsing up to offset
+    long analysis_length;      // Bytes of the analysis holding those issues
+    uint64_t fingerprint;      // Hash of the first line of the log
+    long line_offset;          // Where the last line parsed starts
+    uint64_t line_fingerprint; // Hash of the last line parsed
+    uint64_t analysis_fingerprint; // Hash of the analysis up to its length
+} mtrack_checkpoint_t;
+
+#define MTRACK_HASH_SEED 14695981039346656037ULL
+
+void mtrack_checkpoint_init(mtrack_checkpoint_t* checkpoint);
+
+uint64_t mtrack_hash(FILE* stream, long start, long end, uint64_t hash);
+uint64_t mtrack_checkpoint_fingerprint(FILE* istream);
+bool mtrack_checkpoint_valid(const mtrack_checkpoint_t* checkpoint,
+                             FILE* istream);
+bool mtrack_checkpoint_owns(const mtrack_checkpoint_t* checkpoint,
+                            FILE* ostream);
+
+bool mtrack_checkpoint_load(mtrack_checkpoint_t* checkpoint,
+                            mtrack_allocations_t* allocations,
+                            const char* path);
+bool mtrack_checkpoint_save(const mtrack_checkpoint_t* checkpoint,
+                            const mtrack_allocations_t* allocations,
+                            const char* path);
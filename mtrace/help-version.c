@@ -12,6 +12,10 @@ const char mtrack_help_text[] =
     "Options:\n"
     "  -i FILE      Provides the location of the input log. Default: mtrack.log.\n"
     "  -o FILE      Provides the location of the resulting analysis. Default: mtrack.analysis.\n"
+    "  -c FILE      Provides the location of the checkpoint used to resume analysis. Default: mtrace.checkpoint.\n"
+    "  --fresh      Ignores any existing checkpoint and analyzes the whole log.\n"
+    "  --follow     Keeps watching the log and analyzes new entries as they are appended.\n"
+    "  --layout     Reports how live blocks are laid out in memory at the peak and at the end.\n"
     "  --help       Shows this help.\n"
     "  --version    Shows version and license information.\n";
 
@@ -0,0 +1,244 @@
+// mtrace: layout.c
+// Copyright (C) 2023 Ethan Uppal. All rights reserved.
+
+#include "layout.h"
+#include <stdlib.h> // malloc, realloc, free, qsort, exit
+#include <string.h> // memcpy, strcmp
+#include <stdint.h> // uintptr_t
+#include "errors.h" // message
+
+#define LAYOUT_PAGE_SIZE 4096
+
+// Live blocks this far apart are in different heaps, arenas or mappings.
+#define LAYOUT_REGION_GAP ((uintptr_t)1 << 20)
+
+// A page with less than this share of it live is sparse: it stays resident
+// although almost nothing on it is used.
+#define LAYOUT_SPARSE_DIVISOR 4
+
+#define LAYOUT_SMALL_BLOCK 256
+#define LAYOUT_TOP_SITES 10
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    size_t blocks;
+    size_t bytes;
+    size_t pages;
+} region_t;
+
+// A page only partially covered by live blocks. The blocks on it are
+// array[first] through array[last] of the sorted blocks.
+typedef struct {
+    uintptr_t page;
+    size_t bytes;
+    size_t first;
+    size_t last;
+} page_t;
+
+typedef struct {
+    const char* file;
+    size_t line;
+    size_t blocks;
+    size_t bytes;
+    size_t pages;
+    size_t seen;       // One past the last page counted in pages
+    size_t seen_block; // One past the last block counted in blocks
+    double pinned;
+} site_t;
+
+static void* checked_realloc(void* pointer, size_t bytes) {
+    pointer = realloc(pointer, bytes);
+    if (pointer == NULL) {
+        message(ERROR, "Unable to analyze layout", "Virtual memory is exhausted");
+        exit(EXIT_FAILURE);
+    }
+    return pointer;
+}
+
+#define append(array, length, capacity, value) do { \
+    if ((length) + 1 > (capacity)) { \
+        (capacity) = (capacity) ? (capacity) * 2 : 4; \
+        (array) = checked_realloc((array), sizeof(*(array)) * (capacity)); \
+    } \
+    (array)[(length)++] = (value); \
+} while (0)
+
+static int compare_address(const void* lhs, const void* rhs) {
+    const uintptr_t a = (uintptr_t)((const mtrack_block_t*)lhs)->pointer;
+    const uintptr_t b = (uintptr_t)((const mtrack_block_t*)rhs)->pointer;
+    return (a > b) - (a < b);
+}
+
+static int compare_pinned(const void* lhs, const void* rhs) {
+    const double a = ((const site_t*)lhs)->pinned;
+    const double b = ((const site_t*)rhs)->pinned;
+    return (a < b) - (a > b);
+}
+
+// Adds the part of the block at [start, end) on the given page to the page,
+// merging with the last page if the previous block ended on it.
+static void add_page(page_t** pages, size_t* length, size_t* capacity,
+                     uintptr_t page, uintptr_t start, uintptr_t end,
+                     size_t index, region_t* region) {
+    const uintptr_t page_start = page * LAYOUT_PAGE_SIZE;
+    const uintptr_t page_end = page_start + LAYOUT_PAGE_SIZE;
+    const size_t overlap = (end < page_end ? end : page_end)
+                           - (start > page_start ? start : page_start);
+    if (*length > 0 && (*pages)[*length - 1].page == page) {
+        (*pages)[*length - 1].bytes += overlap;
+        (*pages)[*length - 1].last = index;
+        return;
+    }
+    page_t record = {
+        .page = page,
+        .bytes = overlap,
+        .first = index,
+        .last = index
+    };
+    append(*pages, *length, *capacity, record);
+    region->pages++;
+}
+
+static site_t* find_site(site_t** sites, size_t* length, size_t* capacity,
+                         const mtrack_block_t* block) {
+    for (size_t i = 0; i < *length; i++) {
+        site_t* site = &(*sites)[i];
+        if (site->line == block->line && site->file && block->file
+            && strcmp(site->file, block->file) == 0) {
+            return site;
+        }
+    }
+    site_t site = {
+        .file = block->file,
+        .line = block->line
+    };
+    append(*sites, *length, *capacity, site);
+    return &(*sites)[*length - 1];
+}
+
+// Whether a block has been live for at least the latter half of the log.
+static bool long_lived(const mtrack_block_t* block,
+                       const mtrack_snapshot_t* snapshot) {
+    return (snapshot->operations - block->serial) * 2 >= snapshot->operations;
+}
+
+void mtrack_layout_report(const mtrack_snapshot_t* snapshot,
+                          const char* when, FILE* ostream) {
+    if (snapshot->length == 0) {
+        fprintf(ostream, "layout: %s, no blocks are live.\n", when);
+        return;
+    }
+    const size_t count = snapshot->length;
+    mtrack_block_t* blocks = checked_realloc(NULL, sizeof(mtrack_block_t)
+                                                   * count);
+    memcpy(blocks, snapshot->array, sizeof(mtrack_block_t) * count);
+    qsort(blocks, count, sizeof(mtrack_block_t), compare_address);
+
+    // Walk the address space in order, splitting it into regions and
+    // recording every page that live blocks only partially cover
+    region_t* regions = NULL;
+    size_t region_count = 0, region_capacity = 0;
+    page_t* pages = NULL;
+    size_t page_count = 0, page_capacity = 0;
+    size_t full_pages = 0, bytes = 0, gaps = 0, largest_gap = 0;
+    for (size_t i = 0; i < count; i++) {
+        const uintptr_t start = (uintptr_t)blocks[i].pointer;
+        const uintptr_t end = start + blocks[i].bytes;
+        region_t* region = region_count ? &regions[region_count - 1] : NULL;
+        if (region == NULL || start >= region->end + LAYOUT_REGION_GAP) {
+            region_t next = { .start = start, .end = end };
+            append(regions, region_count, region_capacity, next);
+            region = &regions[region_count - 1];
+        } else if (start > region->end) {
+            const size_t gap = start - region->end;
+            gaps += gap;
+            if (gap > largest_gap) {
+                largest_gap = gap;
+            }
+        }
+        if (end > region->end) {
+            region->end = end;
+        }
+        region->blocks++;
+        region->bytes += blocks[i].bytes;
+        bytes += blocks[i].bytes;
+
+        const uintptr_t first = start / LAYOUT_PAGE_SIZE;
+        const uintptr_t last = end > start ? (end - 1) / LAYOUT_PAGE_SIZE
+                                           : first;
+        add_page(&pages, &page_count, &page_capacity, first, start, end, i,
+                 region);
+        if (last > first) {
+            full_pages += last - first - 1;
+            region->pages += last - first - 1;
+            add_page(&pages, &page_count, &page_capacity, last, start, end,
+                     i, region);
+        }
+    }
+
+    // Charge what each sparse page wastes to the small long-lived blocks
+    // keeping it resident
+    site_t* sites = NULL;
+    size_t site_count = 0, site_capacity = 0;
+    size_t sparse_pages = 0, pinned = 0;
+    for (size_t i = 0; i < page_count; i++) {
+        const page_t* page = &pages[i];
+        if (page->bytes * LAYOUT_SPARSE_DIVISOR >= LAYOUT_PAGE_SIZE) {
+            continue;
+        }
+        sparse_pages++;
+        const size_t waste = LAYOUT_PAGE_SIZE - page->bytes;
+        pinned += waste;
+        size_t culprits = 0;
+        for (size_t j = page->first; j <= page->last; j++) {
+            if (blocks[j].bytes <= LAYOUT_SMALL_BLOCK
+                && long_lived(&blocks[j], snapshot)) {
+                culprits++;
+            }
+        }
+        for (size_t j = page->first; j <= page->last; j++) {
+            const mtrack_block_t* block = &blocks[j];
+            if (block->bytes > LAYOUT_SMALL_BLOCK
+                || !long_lived(block, snapshot)) {
+                continue;
+            }
+            site_t* site = find_site(&sites, &site_count, &site_capacity,
+                                     block);
+            site->pinned += (double)waste / culprits;
+            if (site->seen != i + 1) {
+                site->seen = i + 1;
+                site->pages++;
+            }
+            // A block straddling two sparse pages is only counted once
+            if (site->seen_block != j + 1) {
+                site->seen_block = j + 1;
+                site->blocks++;
+                site->bytes += block->bytes;
+            }
+        }
+    }
+
+    size_t span = 0;
+    for (size_t i = 0; i < region_count; i++) {
+        span += regions[i].end - regions[i].start;
+    }
+    fprintf(ostream, "layout: %s, %zu block(s) holding %zu bytes are live across %zu region(s) spanning %zu bytes (%.1f%% dense).\n", when, count, bytes, region_count, span, span ? 100.0 * bytes / span : 100.0);
+    fprintf(ostream, "layout: %s, gaps between blocks total %zu bytes and the largest is %zu bytes (%.1f%% external fragmentation).\n", when, gaps, largest_gap, gaps ? 100.0 * (gaps - largest_gap) / gaps : 0.0);
+    fprintf(ostream, "layout: %s, blocks touch %zu page(s) and %zu of them are less than 1/%d used, pinning %zu otherwise free bytes.\n", when, page_count + full_pages, sparse_pages, LAYOUT_SPARSE_DIVISOR, pinned);
+    for (size_t i = 0; i < region_count; i++) {
+        const region_t* region = &regions[i];
+        fprintf(ostream, "region: %s, %p to %p holds %zu block(s) with %zu bytes on %zu page(s).\n", when, (void*)region->start, (void*)region->end, region->blocks, region->bytes, region->pages);
+    }
+
+    qsort(sites, site_count, sizeof(site_t), compare_pinned);
+    for (size_t i = 0; i < site_count && i < LAYOUT_TOP_SITES; i++) {
+        const site_t* site = &sites[i];
+        fprintf(ostream, "bloat: %s, %zu small long-lived block(s) (%zu bytes) allocated at %s:%zu sit on %zu sparse page(s), pinning about %.0f bytes.\n", when, site->blocks, site->bytes, site->file, site->line, site->pages, site->pinned);
+    }
+
+    free(sites);
+    free(pages);
+    free(regions);
+    free(blocks);
+}
@@ -0,0 +1,10 @@
+// mtrace: layout.h
+// Copyright (C) 2023 Ethan Uppal. All rights reserved.
+
+#pragma once
+
+#include <stdio.h>
+#include "allocations.h"
+
+void mtrack_layout_report(const mtrack_snapshot_t* snapshot,
+                          const char* when, FILE* ostream);
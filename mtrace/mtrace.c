@@ -1,17 +1,33 @@
 // malloc-tracker: mtrace.c: Analyzes a tracking log for its properties.
 // Copyright (C) 2021 Ethan Uppal. All rights reserved.
 
+#define _POSIX_C_SOURCE 200809L
 #include <string.h> // strcmp
 #include <stdlib.h> // exit, EXIT_SUCCESS, EXIT_FAILURE
+#include <stdbool.h> // bool
+#include <unistd.h> // ftruncate, sleep
 #include "help-version.h" // mtrack_show_help, mtrack_show_version
 #include "allocations.h" // MTRACK_ISSUE_DETECTED, mtrack_allocations_t, mtrack_allocations_init, mtrack_allocations_destroy, mtrack_parse, mtrack_scan
+#include "checkpoint.h" // mtrack_checkpoint_t, mtrack_checkpoint_init, mtrack_checkpoint_load, mtrack_checkpoint_save, mtrack_checkpoint_valid, mtrack_checkpoint_owns, mtrack_checkpoint_fingerprint, mtrack_hash, MTRACK_HASH_SEED
+#include "layout.h" // mtrack_layout_report
 #include "errors.h" // message
 
 // Returns true if the given strings are equal in length.
 #define strequ(str, str2) ((str) == NULL ? 0 : strcmp(str, str2) == 0)
 
-static void parse_args(int argc, const char* argv[], const char** infile,
-                       const char** outfile) {
+// Seconds to wait between polls of the log in --follow mode.
+#define FOLLOW_INTERVAL 1
+
+struct options {
+    const char* infile;
+    const char* outfile;
+    const char* checkpoint;
+    bool follow;
+    bool fresh;
+    bool layout;
+};
+
+static void parse_args(int argc, const char* argv[], struct options* options) {
     if (strequ(argv[1], "--help")) {
         mtrack_show_help(argv[0]);
         exit(EXIT_SUCCESS);
@@ -24,68 +40,226 @@ static void parse_args(int argc, const char* argv[], const char** infile,
             switch (argv[i][1]) {
                 case 'i': {
                     i++;
-                    *infile = argv[i];
-                    if (*infile == NULL) {
+                    options->infile = argv[i];
+                    if (options->infile == NULL) {
                         message(ERROR, "Expected file name after -i option",
                                 NULL);
                         exit(EXIT_FAILURE);
                     }
+                    break;
                 }
                 case 'o': {
                     i++;
-                    *outfile = argv[i];
-                    if (*outfile == NULL) {
+                    options->outfile = argv[i];
+                    if (options->outfile == NULL) {
                         message(ERROR, "Expected file name after -o option",
                                 NULL);
                         exit(EXIT_FAILURE);
                     }
+                    break;
+                }
+                case 'c': {
+                    i++;
+                    options->checkpoint = argv[i];
+                    if (options->checkpoint == NULL) {
+                        message(ERROR, "Expected file name after -c option",
+                                NULL);
+                        exit(EXIT_FAILURE);
+                    }
+                    break;
+                }
+                case '-': {
+                    if (strequ(argv[i], "--follow")) {
+                        options->follow = true;
+                    } else if (strequ(argv[i], "--fresh")) {
+                        options->fresh = true;
+                    } else if (strequ(argv[i], "--layout")) {
+                        options->layout = true;
+                    }
+                    break;
                 }
             }
         }
     }
 }
 
+// Set while parsing, so that a log mtrack_parse rejects also takes the
+// checkpoint with it instead of failing the same way on every later run.
+static const char* parsing_checkpoint = NULL;
+
+static void drop_checkpoint(void) {
+    if (parsing_checkpoint) {
+        remove(parsing_checkpoint);
+    }
+}
+
+// Drops all state so that the log is analyzed again from its beginning.
+static void reset(mtrack_checkpoint_t* checkpoint,
+                  mtrack_allocations_t* allocations) {
+    mtrack_checkpoint_init(checkpoint);
+    mtrack_allocations_reset(allocations);
+}
+
+// Folds every complete line of the log past the checkpoint into the
+// allocations, then rewrites the leak report (and the layout report if
+// requested) at the end of the analysis. Returns whether any new lines were
+// read.
+static bool analyze(mtrack_checkpoint_t* checkpoint,
+                    mtrack_allocations_t* allocations, FILE* istream,
+                    FILE* ostream, bool layout, size_t* issue_count) {
+    const long start = checkpoint->offset;
+    fflush(ostream);
+    if (ftruncate(fileno(ostream), checkpoint->analysis_length) != 0) {
+        perror("ftruncate");
+        exit(EXIT_FAILURE);
+    }
+    fseek(ostream, checkpoint->analysis_length, SEEK_SET);
+    fseek(istream, checkpoint->offset, SEEK_SET);
+
+    char* line = NULL;
+    size_t n = 0;
+    ssize_t read;
+    while ((read = getline(&line, &n, istream)) != -1) {
+        // The program may still be writing the last line
+        if (line[read - 1] != '\n') {
+            break;
+        }
+        if (mtrack_parse(allocations, line, n, ostream)
+            == MTRACK_ISSUE_DETECTED) {
+            checkpoint->issue_count++;
+        }
+        checkpoint->line_offset = checkpoint->offset;
+        checkpoint->offset += read;
+        free(line);
+        line = NULL;
+        n = 0;
+    }
+    free(line);
+    clearerr(istream);
+    if (checkpoint->offset != start) {
+        checkpoint->line_fingerprint = mtrack_hash(istream,
+                                                   checkpoint->line_offset,
+                                                   checkpoint->offset,
+                                                   MTRACK_HASH_SEED);
+    }
+    // Extend the hash of the analysis over the issues just written
+    const long analysis_start = checkpoint->analysis_length;
+    fflush(ostream);
+    checkpoint->analysis_length = ftell(ostream);
+    checkpoint->analysis_fingerprint = mtrack_hash(ostream, analysis_start,
+                                                   checkpoint->analysis_length,
+                                                   checkpoint->analysis_fingerprint);
+    fseek(ostream, checkpoint->analysis_length, SEEK_SET);
+
+    *issue_count = checkpoint->issue_count;
+    int leaks = mtrack_scan(allocations, ostream);
+    if (leaks > 0) {
+        *issue_count += leaks;
+    }
+    if (layout) {
+        mtrack_layout_report(mtrack_allocations_peak(allocations),
+                             "At the peak", ostream);
+        mtrack_snapshot_t end;
+        mtrack_snapshot_init(&end);
+        mtrack_snapshot_take(&end, allocations);
+        mtrack_layout_report(&end, "At the end", ostream);
+        mtrack_snapshot_destroy(&end);
+    }
+    fflush(ostream);
+    return checkpoint->offset != start;
+}
+
+static void report(size_t issue_count) {
+    if (issue_count > 0) {
+        printf("%zu issue%s found.\n", issue_count,
+               issue_count == 1 ? "" : "s");
+    } else {
+        printf("No issues found.\n");
+    }
+    fflush(stdout);
+}
+
 int main(int argc, char const* argv[]) {
-    const char* infile = "mtrack.log";
-    const char* outfile = "mtrace.analysis";
-    parse_args(argc, argv, &infile, &outfile);
+    struct options options = {
+        .infile = "mtrack.log",
+        .outfile = "mtrace.analysis",
+        .checkpoint = "mtrace.checkpoint",
+        .follow = false,
+        .fresh = false,
+        .layout = false
+    };
+    parse_args(argc, argv, &options);
 
+    atexit(drop_checkpoint);
     mtrack_allocations_t allocations;
     mtrack_allocations_init(&allocations);
-    char* line = NULL;
-    size_t n = 0;
-    FILE* istream = fopen(infile, "r");
+    FILE* istream = fopen(options.infile, "r");
     if (istream == NULL) {
         message(ERROR, "Could not find log file in directory", "Run --help for a list of options");
         return EXIT_FAILURE;
     }
-    FILE* ostream = fopen(outfile, "wa");
+
+    // Resume from the checkpoint only if it still describes this log and the
+    // analysis it was written alongside
+    mtrack_checkpoint_t checkpoint;
+    mtrack_checkpoint_init(&checkpoint);
+    FILE* ostream = NULL;
+    if (!options.fresh
+        && mtrack_checkpoint_load(&checkpoint, &allocations,
+                                  options.checkpoint)
+        && mtrack_checkpoint_valid(&checkpoint, istream)
+        // A layout needs the peak, which is only tracked on request
+        && (allocations.track_peak || !options.layout)) {
+        ostream = fopen(options.outfile, "r+");
+        if (ostream != NULL && !mtrack_checkpoint_owns(&checkpoint, ostream)) {
+            fclose(ostream);
+            ostream = NULL;
+        }
+    }
+    if (ostream == NULL) {
+        reset(&checkpoint, &allocations);
+        ostream = fopen(options.outfile, "w+");
+    }
     if (ostream == NULL) {
         perror("fopen");
         return EXIT_FAILURE;
     }
+    allocations.track_peak = options.layout;
+
     size_t issue_count = 0;
-    while (getline(&line, &n, istream) != -1) {
-        if (mtrack_parse(&allocations, line, n, ostream)
-            == MTRACK_ISSUE_DETECTED) {
-            issue_count++;
+    bool first = true;
+    for (;;) {
+        parsing_checkpoint = options.checkpoint;
+        const bool changed = analyze(&checkpoint, &allocations, istream,
+                                     ostream, options.layout, &issue_count);
+        parsing_checkpoint = NULL;
+        if (changed || first) {
+            checkpoint.fingerprint = mtrack_checkpoint_fingerprint(istream);
+            if (!mtrack_checkpoint_save(&checkpoint, &allocations,
+                                        options.checkpoint)) {
+                message(ERROR, "Could not write checkpoint",
+                        "Analysis will restart from the beginning next run");
+            }
+            report(issue_count);
+        }
+        if (!options.follow) {
+            break;
+        }
+        first = false;
+        sleep(FOLLOW_INTERVAL);
+        // Reopen rather than seek so that no stale buffered data is reread
+        fclose(istream);
+        while ((istream = fopen(options.infile, "r")) == NULL) {
+            sleep(FOLLOW_INTERVAL);
+        }
+        // The tracked program was rerun and started a new log
+        if (!mtrack_checkpoint_valid(&checkpoint, istream)) {
+            reset(&checkpoint, &allocations);
         }
-        free(line);
-        line = NULL;
-        n = 0;
-    }
-    int leaks = mtrack_scan(&allocations, ostream);
-    if (leaks > 0) {
-        issue_count += leaks;
     }
+
     mtrack_allocations_destroy(&allocations);
     fclose(istream);
     fclose(ostream);
-    if (issue_count > 0) {
-        printf("%zu issue%s found.\n", issue_count,
-               issue_count == 1 ? "" : "s");
-    } else {
-        printf("No issues found.\n");
-    }
     return 0;
 }
@@ -3,21 +3,76 @@
 
 #define MTRACK_ENABLE
 #include "_tracker.h"
+#include <string.h>
+
+#ifdef MTRACK_AUTOLOG
+#define COMPILED_FEATURES (MTRACK_FEATURES)
+#else
+#define COMPILED_FEATURES (MTRACK_FEATURES & ~TRACE_FEATURE_LOGGING)
+#endif
+
+// Features compiled out fold to false here, so their code is dropped entirely.
+#define feature_enabled(feature) \
+    ((COMPILED_FEATURES & (feature)) && (features & (feature)))
+
+// With nothing to record, the t-prefix variants reduce to a single check.
+#define tracing_disabled() (!(COMPILED_FEATURES & features))
+
+#define DEFAULT_SAMPLE_RATE 64
 
 static malloc_trace_t trace;
+static trace_feature_t features;
+static uint64_t sample_rate = DEFAULT_SAMPLE_RATE;
 #ifdef MTRACK_AUTOLOG
 FILE* logfile;
 #endif
 
+// Decides by address so that an allocation and its free are sampled together.
+static inline bool trace_sampled(const void* ptr) {
+    if (!feature_enabled(TRACE_FEATURE_SAMPLING)) {
+        return true;
+    }
+    const uint64_t hash = ((uint64_t)(uintptr_t)ptr >> 4)
+                          * 11400714819323198485ULL;
+    return (hash >> 32) % sample_rate == 0;
+}
+
+static inline void trace_time(struct timespec* time) {
+    if (feature_enabled(TRACE_FEATURE_TIMING)) {
+        clock_gettime(CLOCK_MONOTONIC, time);
+    }
+}
+
+static void trace_record(const allocation_t* allocation) {
+    #ifdef MTRACK_AUTOLOG
+    if (feature_enabled(TRACE_FEATURE_LOGGING)) {
+        dump_allocation(allocation, TRACE_DUMP_MODE_LOGGING, logfile);
+    }
+    #endif
+    if (feature_enabled(TRACE_FEATURE_HISTORY)) {
+        trace_append(&trace, *allocation);
+    }
+    if (feature_enabled(TRACE_FEATURE_FOOTPRINT)) {
+        trace.footprint += allocation->length;
+    }
+}
+
 void* _tmalloc(size_t n, const char* file, size_t line) {
-    struct timespec start, end;
-    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (tracing_disabled()) {
+        void* block = malloc(n);
+        if (block == NULL) {
+            trace_abort("Virtual memory exhausted\n");
+        }
+        return block;
+    }
+    struct timespec start = {0}, end = {0};
+    trace_time(&start);
     void* block = malloc(n);
-    clock_gettime(CLOCK_MONOTONIC, &end);
+    trace_time(&end);
     if (block == NULL) {
         trace_abort("Virtual memory exhausted\n");
     }
-    if (trace.allocations != NULL) {
+    if (trace.allocations != NULL && trace_sampled(block)) {
         allocation_t a = {
             .previous = NULL,
             .pointer = block,
@@ -28,39 +83,55 @@ void* _tmalloc(size_t n, const char* file, size_t line) {
             .start = start.tv_nsec,
             .end = end.tv_nsec
         };
-        #ifdef MTRACK_AUTOLOG
-        dump_allocation(&a, TRACE_DUMP_MODE_LOGGING, logfile);
-        #endif
-        trace_append(&trace, a);
-        trace.footprint += n;
+        trace_record(&a);
     }
     return block;
 }
 
 void* _trealloc(void* ptr, size_t n, const char* file, size_t line) {
-    struct timespec start, end;
-    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (tracing_disabled()) {
+        void* block = realloc(ptr, n);
+        if (block == NULL) {
+            trace_abort("Virtual memory exhausted\n");
+        }
+        return block;
+    }
+    // When sampling, either side may be tracked without the other. Decide
+    // for ptr now, as it must not be read once realloc has freed it.
+    void* const previous = ptr != NULL && trace_sampled(ptr) ? ptr : NULL;
+    // The old block leaves the footprint, whether or not the new one joins it
+    size_t previous_length = 0;
+    if (previous != NULL && trace.allocations != NULL
+        && feature_enabled(TRACE_FEATURE_FOOTPRINT)) {
+        const allocation_t* allocation = trace_search(&trace, previous);
+        previous_length = allocation == NULL ? 0 : allocation->length;
+    }
+    struct timespec start = {0}, end = {0};
+    trace_time(&start);
     void* block = realloc(ptr, n);
-    clock_gettime(CLOCK_MONOTONIC, &end);
+    trace_time(&end);
     if (block == NULL) {
         trace_abort("Virtual memory exhausted\n");
     }
     if (trace.allocations != NULL) {
+        const bool current = trace_sampled(block);
+        if (!previous && !current) {
+            return block;
+        }
         allocation_t a = {
-            .previous = ptr,
-            .pointer = block,
-            .length = n,
-            .state = ALLOCATION_STATE_REALLOCATED,
+            .previous = previous,
+            .pointer = current ? block : NULL,
+            .length = current ? n : 0,
+            .state = !current ? ALLOCATION_STATE_FREED
+                     : !previous ? ALLOCATION_STATE_ALLOCATED
+                     : ALLOCATION_STATE_REALLOCATED,
             .file = file,
             .line = line,
             .start = start.tv_nsec,
             .end = end.tv_nsec
         };
-        #ifdef MTRACK_AUTOLOG
-        dump_allocation(&a, TRACE_DUMP_MODE_LOGGING, logfile);
-        #endif
-        trace_append(&trace, a);
-        trace.footprint += n;
+        trace_record(&a);
+        trace.footprint -= previous_length;
     }
     return block;
 }
@@ -69,6 +140,11 @@ void _tfree(void* ptr, const char* file, size_t line) {
     if (!ptr) {
         return;
     }
+    if (tracing_disabled() || trace.allocations == NULL
+        || !trace_sampled(ptr)) {
+        free(ptr);
+        return;
+    }
     allocation_t a = {
         .previous = ptr,
         .pointer = NULL,
@@ -78,18 +154,23 @@ void _tfree(void* ptr, const char* file, size_t line) {
         .line = line,
     };
     #ifdef MTRACK_AUTOLOG
-    dump_allocation(&a, TRACE_DUMP_MODE_LOGGING, logfile);
-    fflush(logfile);
+    if (feature_enabled(TRACE_FEATURE_LOGGING)) {
+        dump_allocation(&a, TRACE_DUMP_MODE_LOGGING, logfile);
+        fflush(logfile);
+    }
     #endif
 
-    struct timespec start, end;
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    free(ptr);
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    if (trace.allocations != NULL) {
+    if (feature_enabled(TRACE_FEATURE_FOOTPRINT)) {
         const allocation_t* allocation = trace_search(&trace, ptr);
         const size_t length = allocation == NULL ? 0 : allocation->length;
         trace.footprint -= length;
+    }
+
+    struct timespec start = {0}, end = {0};
+    trace_time(&start);
+    free(ptr);
+    trace_time(&end);
+    if (feature_enabled(TRACE_FEATURE_HISTORY)) {
         a.start = start.tv_nsec;
         a.end = end.tv_nsec;
         trace_append(&trace, a);
@@ -109,18 +190,105 @@ static void trace_append(malloc_trace_t* trace, allocation_t allocation) {
     trace->allocations[trace->length++] = allocation;
 }
 
+// Searches from the most recent operation, as addresses are reused and only
+// the latest block at ptr can still be live.
 static allocation_t* trace_search(malloc_trace_t* trace, void* ptr) {
-    allocation_t* allocation = trace->allocations;
+    allocation_t* allocation = trace->allocations + trace->length;
     for (size_t i = 0; i < trace->length; i++) {
+        allocation--;
         if (allocation->pointer == ptr) {
             return allocation;
         }
-        allocation++;
     }
     return NULL;
 }
 
+static const struct {
+    const char* name;
+    trace_feature_t feature;
+} feature_names[] = {
+    { "timing", TRACE_FEATURE_TIMING },
+    { "logging", TRACE_FEATURE_LOGGING },
+    { "history", TRACE_FEATURE_HISTORY },
+    { "footprint", TRACE_FEATURE_FOOTPRINT },
+    { "sampling", TRACE_FEATURE_SAMPLING },
+    { "all", TRACE_FEATURE_ALL },
+    { "none", 0 }
+};
+
+// Applies a comma-separated list such as "none,history,footprint" or
+// "-timing" to the given features. A name turns its feature on, a name
+// prefixed with '-' turns it off, and "all" and "none" replace the set.
+// Features turned off by name are also added to disabled.
+static trace_feature_t parse_features(const char* spec,
+                                      trace_feature_t features,
+                                      trace_feature_t* disabled) {
+    while (*spec) {
+        const bool disable = *spec == '-';
+        if (disable) {
+            spec++;
+        }
+        const size_t length = strcspn(spec, ",");
+        bool found = false;
+        for (size_t i = 0; i < sizeof(feature_names) / sizeof(*feature_names); i++) {
+            if (strlen(feature_names[i].name) == length
+                && strncmp(feature_names[i].name, spec, length) == 0) {
+                const trace_feature_t feature = feature_names[i].feature;
+                if (disable) {
+                    features &= ~feature;
+                    *disabled |= feature;
+                } else if (feature == 0 || feature == TRACE_FEATURE_ALL) {
+                    features = feature;
+                } else {
+                    features |= feature;
+                }
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            trace_warning("Unknown feature '%.*s' in MTRACK_FEATURES\n",
+                          (int)length, spec);
+        }
+        spec += length;
+        if (*spec == ',') {
+            spec++;
+        }
+    }
+    return features;
+}
+
 void tinit() {
+    // Sampling changes what the log means, so it is only used on request
+    features = COMPILED_FEATURES & ~TRACE_FEATURE_SAMPLING;
+    trace_feature_t disabled = 0;
+    const char* spec = getenv("MTRACK_FEATURES");
+    if (spec) {
+        features = parse_features(spec, features, &disabled)
+                   & COMPILED_FEATURES;
+    }
+    // Freeing looks up the size of the block in the history, so footprint
+    // brings history with it unless history was turned off by name
+    if ((features & TRACE_FEATURE_FOOTPRINT)
+        && !(features & TRACE_FEATURE_HISTORY)) {
+        if ((disabled & TRACE_FEATURE_HISTORY)
+            || !(COMPILED_FEATURES & TRACE_FEATURE_HISTORY)) {
+            trace_warning("footprint needs history, so it is turned off too\n");
+            features &= ~TRACE_FEATURE_FOOTPRINT;
+        } else {
+            features |= TRACE_FEATURE_HISTORY;
+        }
+    }
+    const char* rate = getenv("MTRACK_SAMPLE_RATE");
+    if (rate) {
+        sample_rate = strtoull(rate, NULL, 10);
+        if (sample_rate == 0) {
+            trace_warning("Invalid MTRACK_SAMPLE_RATE, using %d\n",
+                          DEFAULT_SAMPLE_RATE);
+            sample_rate = DEFAULT_SAMPLE_RATE;
+        }
+    }
+
     trace.length = 0;
     trace.capacity = 4;
     trace.allocations = (allocation_t*)malloc(sizeof(allocation_t)
@@ -132,12 +300,17 @@ void tinit() {
     }
 
     #ifdef MTRACK_AUTOLOG
-    // Empty log file
-    fclose(fopen("mtrack.log", "w"));
-    logfile = fopen("mtrack.log", "a");
-    if (!logfile) {
-        trace_abort("fopen");
-        return;
+    // Empty log file, even when not logging at runtime, so that a log left by
+    // an earlier run is not taken for this one
+    if (COMPILED_FEATURES & TRACE_FEATURE_LOGGING) {
+        fclose(fopen("mtrack.log", "w"));
+    }
+    if (feature_enabled(TRACE_FEATURE_LOGGING)) {
+        logfile = fopen("mtrack.log", "a");
+        if (!logfile) {
+            trace_abort("fopen");
+            return;
+        }
     }
     #endif
 }
@@ -240,6 +413,11 @@ void tdump_on_exit() {
     atexit(_tdump);
 }
 
+// When sampling, only about one in sample_rate blocks is counted, so the
+// footprint is scaled up to estimate the whole.
 size_t tusage() {
+    if (feature_enabled(TRACE_FEATURE_SAMPLING)) {
+        return trace.footprint * sample_rate;
+    }
     return trace.footprint;
 }
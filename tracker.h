@@ -12,6 +12,22 @@ typedef enum {
     TRACE_DUMP_MODE_LOGGING
 } trace_dump_mode_t;
 
+// The parts of tracking that can be turned off to make the t-prefix variants
+// cheaper. MTRACK_FEATURES selects which are compiled in and the
+// MTRACK_FEATURES environment variable, read by tinit, which of those are used.
+typedef enum {
+    TRACE_FEATURE_TIMING = 1 << 0,    // Time each operation for tdump
+    TRACE_FEATURE_LOGGING = 1 << 1,   // Write mtrack.log (needs MTRACK_AUTOLOG)
+    TRACE_FEATURE_HISTORY = 1 << 2,   // Retain every operation for tdump
+    TRACE_FEATURE_FOOTPRINT = 1 << 3, // Count live bytes for tusage
+    TRACE_FEATURE_SAMPLING = 1 << 4,  // Only track one in MTRACK_SAMPLE_RATE
+    TRACE_FEATURE_ALL = (1 << 5) - 1
+} trace_feature_t;
+
+#ifndef MTRACK_FEATURES
+#define MTRACK_FEATURES TRACE_FEATURE_ALL
+#endif
+
 #ifdef MTRACK_ENABLE
 
 void* _tmalloc(size_t n, const char* file, size_t line);